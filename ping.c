@@ -10,10 +10,16 @@
 
 #include "esp_wifi.h"
 #include "esp_log.h"
+#include "esp_mac.h"
 
 #include "lwip/sockets.h"
 #include "lwip/netdb.h"
+#include "lwip/sys.h"
+#include "lwip/icmp.h"
+#include "lwip/inet_chksum.h"
+#include "lwip/prot/ip4.h"
 #include "ping/ping_sock.h"
+#include "ping.h"
 
 #define PING_COUNT_TEST     2
 
@@ -184,3 +190,361 @@ esp_err_t ping_initialize(uint32_t interval_ms, uint32_t task_prio, char *target
     return ret;
 }
 
+
+// --- Station prober ---
+/*
+esp_ping sessions are bound to a single target, so the prober shares one raw ICMP socket:
+each round sends echo requests to the DHCP clients back to back, then collects
+the replies within one timeout window.
+The socket receives every ICMP packet of the device into a mailbox of DEFAULT_RAW_RECVMBOX_SIZE
+entries, excess packets are dropped. Requests therefore go out in bursts of PROBER_BURST,
+one less than the mailbox size, and each burst is drained before the next one.
+*/
+
+#define PROBER_ID           0xAFAF
+#define PROBER_DATA_SIZE    32
+#define PROBER_MAX_STA      CONFIG_WIFI_AP_MAX_STA_CONN
+
+#if DEFAULT_RAW_RECVMBOX_SIZE > 1
+#define PROBER_BURST        (DEFAULT_RAW_RECVMBOX_SIZE - 1)
+#else
+#define PROBER_BURST        1
+#endif
+
+#define PROBER_STOP_BIT     (1 << 0)
+#define PROBER_DONE_BIT     (1 << 1)
+
+#define PROBER_IDLE         (0)
+#define PROBER_RUNNING      (1)
+#define PROBER_BUSY         (2)     // being started or stopped
+
+typedef struct {
+    ping_sta_stats_t stats;
+    uint32_t sent_ms;
+    uint32_t rtt_ms;
+    bool sent;
+    bool replied;
+    int burst;              // burst of the round the request was sent in
+} prober_sta_t;
+
+static EventGroupHandle_t s_prober_event_group = NULL;
+static uint8_t s_prober_state = PROBER_IDLE;
+static portMUX_TYPE s_prober_spinlock = portMUX_INITIALIZER_UNLOCKED;
+static uint32_t s_prober_interval_ms;
+static uint32_t s_prober_timeout_ms;
+static uint8_t s_prober_max_missed;
+
+// owned by the prober task
+static prober_sta_t s_work[PROBER_MAX_STA];
+static int s_work_num;
+
+// snapshot of the last round for ping_sta_prober_get()
+static ping_sta_stats_t s_stats[PROBER_MAX_STA];
+static int s_stats_num;
+static portMUX_TYPE s_stats_spinlock = portMUX_INITIALIZER_UNLOCKED;
+
+static void prober_refresh(esp_netif_t *netif)
+{
+    wifi_sta_list_t list;
+    if (esp_wifi_ap_get_sta_list(&list) != ESP_OK) {
+        s_work_num = 0;
+        return;
+    }
+    int num = (list.num < PROBER_MAX_STA) ? list.num : PROBER_MAX_STA;
+    
+    esp_netif_pair_mac_ip_t pairs[PROBER_MAX_STA];
+    for (int i = 0; i < num; i++) {
+        memcpy(pairs[i].mac, list.sta[i].mac, sizeof(pairs[i].mac));
+        pairs[i].ip.addr = 0;
+    }
+    if (num > 0 && esp_netif_dhcps_get_clients_by_mac(netif, num, pairs) != ESP_OK) {
+        ESP_LOGW(TAG, "%s dhcps clients lookup failed", __func__);
+    }
+    
+    // keep the history of stations that are still attached
+    prober_sta_t work[PROBER_MAX_STA] = {0};
+    for (int i = 0; i < num; i++) {
+        for (int j = 0; j < s_work_num; j++) {
+            if (memcmp(s_work[j].stats.mac, pairs[i].mac, sizeof(pairs[i].mac)) == 0) {
+                work[i] = s_work[j];
+                break;
+            }
+        }
+        memcpy(work[i].stats.mac, pairs[i].mac, sizeof(pairs[i].mac));
+        work[i].stats.ip = pairs[i].ip;
+    }
+    memcpy(s_work, work, sizeof(s_work));
+    s_work_num = num;
+}
+
+// read replies until every station of the burst has answered or the deadline passes,
+// late replies to earlier bursts of the round are still recorded
+static void prober_collect(int sock, uint16_t seqno, int burst, uint32_t deadline)
+{
+    int pending = 0;
+    for (int i = 0; i < s_work_num; i++) {
+        if (s_work[i].sent && s_work[i].burst == burst) {
+            pending++;
+        }
+    }
+    
+    char buf[64];
+    while (pending > 0 && (int32_t)(deadline - sys_now()) > 0) {
+        uint32_t left = deadline - sys_now();
+        struct timeval tv = {
+            .tv_sec = left / 1000,
+            .tv_usec = (left % 1000) * 1000,
+        };
+        setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        
+        struct sockaddr_in from;
+        socklen_t fromlen = sizeof(from);
+        int len = recvfrom(sock, buf, sizeof(buf), 0, (struct sockaddr *)&from, &fromlen);
+        if (len < 0) {
+            break; // timeout
+        }
+        struct ip_hdr *iphdr = (struct ip_hdr *)buf;
+        int hlen = IPH_HL(iphdr) * 4;
+        if (len < hlen + (int)sizeof(struct icmp_echo_hdr)) {
+            continue;
+        }
+        struct icmp_echo_hdr *reply = (struct icmp_echo_hdr *)(buf + hlen);
+        if (ICMPH_TYPE(reply) != ICMP_ER || reply->id != PROBER_ID || reply->seqno != htons(seqno)) {
+            continue;
+        }
+        for (int i = 0; i < s_work_num; i++) {
+            prober_sta_t *sta = &s_work[i];
+            if (sta->sent && !sta->replied && sta->stats.ip.addr == from.sin_addr.s_addr) {
+                sta->replied = true;
+                sta->rtt_ms = sys_now() - sta->sent_ms;
+                if (sta->burst == burst) {
+                    pending--;
+                }
+                break;
+            }
+        }
+    }
+}
+
+/*
+account one round of a station
+sent:false if the station has no lease or the request failed locally, such a round is not counted.
+returns true when the station missed max_missed rounds in a row and should be deauthenticated.
+*/
+bool ping_sta_stats_update(ping_sta_stats_t *stats, bool sent, bool replied, uint32_t rtt_ms, uint8_t max_missed)
+{
+    if (!sent) {
+        return false;
+    }
+    stats->transmitted++;
+    if (replied) {
+        stats->received++;
+        stats->rtt_ms = rtt_ms;
+        stats->missed = 0;
+    } else {
+        stats->missed++;
+        ESP_LOGD(TAG, "station "MACSTR" missed %d", MAC2STR(stats->mac), stats->missed);
+    }
+    stats->loss = (uint32_t)((1 - ((float)stats->received) / stats->transmitted) * 100);
+    
+    if (max_missed && stats->missed >= max_missed) {
+        stats->missed = 0;
+        return true;
+    }
+    return false;
+}
+
+static void prober_round(int sock, uint16_t seqno)
+{
+    char pkt[sizeof(struct icmp_echo_hdr) + PROBER_DATA_SIZE];
+    struct icmp_echo_hdr *iecho = (struct icmp_echo_hdr *)pkt;
+    int burst = 0;
+    int burst_len = 0;
+    
+    ICMPH_TYPE_SET(iecho, ICMP_ECHO);
+    ICMPH_CODE_SET(iecho, 0);
+    iecho->id = PROBER_ID;
+    iecho->seqno = htons(seqno);
+    memset(pkt + sizeof(struct icmp_echo_hdr), 'A', PROBER_DATA_SIZE);
+    iecho->chksum = 0;
+    iecho->chksum = inet_chksum(pkt, sizeof(pkt));
+    
+    for (int i = 0; i < s_work_num; i++) {
+        prober_sta_t *sta = &s_work[i];
+        sta->sent = false;
+        sta->replied = false;
+        if (sta->stats.ip.addr == 0) {
+            continue;
+        }
+        struct sockaddr_in to = {
+            .sin_len = sizeof(to),
+            .sin_family = AF_INET,
+            .sin_addr.s_addr = sta->stats.ip.addr,
+        };
+        sta->sent_ms = sys_now();
+        if (sendto(sock, pkt, sizeof(pkt), 0, (struct sockaddr *)&to, sizeof(to)) > 0) {
+            sta->sent = true;
+            sta->burst = burst;
+            burst_len++;
+        }
+        // never have more replies outstanding than the raw socket mailbox can queue
+        if (burst_len == PROBER_BURST) {
+            prober_collect(sock, seqno, burst++, sys_now() + s_prober_timeout_ms);
+            burst_len = 0;
+        }
+    }
+    if (burst_len > 0) {
+        prober_collect(sock, seqno, burst, sys_now() + s_prober_timeout_ms);
+    }
+    
+    for (int i = 0; i < s_work_num; i++) {
+        prober_sta_t *sta = &s_work[i];
+        uint16_t aid;
+        if (ping_sta_stats_update(&sta->stats, sta->sent, sta->replied, sta->rtt_ms, s_prober_max_missed)
+                && esp_wifi_ap_get_sta_aid(sta->stats.mac, &aid) == ESP_OK) {
+            ESP_LOGW(TAG, "station "MACSTR" not responding, deauth AID=%d", MAC2STR(sta->stats.mac), aid);
+            esp_wifi_deauth_sta(aid);
+        }
+    }
+}
+
+static void prober_task(void *arg)
+{
+    int sock = (int)(intptr_t)arg;
+    uint16_t seqno = 0;
+    esp_netif_t *netif = esp_netif_get_handle_from_ifkey("WIFI_AP_DEF");
+    
+    while (!(xEventGroupWaitBits(s_prober_event_group, PROBER_STOP_BIT, pdFALSE, pdFALSE, 
+                                pdMS_TO_TICKS(s_prober_interval_ms)) & PROBER_STOP_BIT)) {
+        prober_refresh(netif);
+        prober_round(sock, ++seqno);
+        
+        taskENTER_CRITICAL(&s_stats_spinlock);
+        for (int i = 0; i < s_work_num; i++) {
+            s_stats[i] = s_work[i].stats;
+        }
+        s_stats_num = s_work_num;
+        taskEXIT_CRITICAL(&s_stats_spinlock);
+    }
+    
+    close(sock);
+    xEventGroupSetBits(s_prober_event_group, PROBER_DONE_BIT);
+    vTaskDelete(NULL);
+}
+
+// called with the prober claimed
+static esp_err_t prober_create(uint32_t interval_ms, uint32_t timeout_ms, uint8_t max_missed, uint32_t task_prio)
+{
+    int sock = socket(AF_INET, SOCK_RAW, IP_PROTO_ICMP);
+    if (sock < 0) {
+        ESP_LOGE(TAG, "%s create socket failed: %d", __func__, sock);
+        return ESP_FAIL;
+    }
+    
+    s_prober_interval_ms = interval_ms;
+    s_prober_timeout_ms = timeout_ms;
+    s_prober_max_missed = max_missed;
+    s_work_num = 0;
+    
+    s_prober_event_group = xEventGroupCreate();
+    if (s_prober_event_group == NULL) {
+        close(sock);
+        return ESP_ERR_NO_MEM;
+    }
+    if (xTaskCreate(prober_task, "sta_prober", 4096, (void *)(intptr_t)sock, task_prio, NULL) != pdPASS) {
+        close(sock);
+        vEventGroupDelete(s_prober_event_group);
+        s_prober_event_group = NULL;
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+/*
+probe stations attached to the SoftAP
+interval_ms:pause between rounds, must not be 0.
+timeout_ms:reply wait time of one burst, must not be 0.
+max_missed:deauthenticate a station after so many rounds without reply. 0 - never.
+task_prio:prober task priority.
+returns ESP_ERR_INVALID_ARG for a zero interval_ms or timeout_ms.
+*/
+esp_err_t ping_sta_prober_start(uint32_t interval_ms, uint32_t timeout_ms, uint8_t max_missed, uint32_t task_prio)
+{
+    if (interval_ms == 0 || timeout_ms == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (esp_netif_get_handle_from_ifkey("WIFI_AP_DEF") == NULL) {
+        ESP_LOGE(TAG, "%s SoftAP is not started", __func__);
+        return ESP_ERR_INVALID_STATE;
+    }
+    
+    // claim the prober, concurrent start/stop calls see PROBER_BUSY
+    bool claimed = false;
+    taskENTER_CRITICAL(&s_prober_spinlock);
+    if (s_prober_state == PROBER_IDLE) {
+        s_prober_state = PROBER_BUSY;
+        claimed = true;
+    }
+    taskEXIT_CRITICAL(&s_prober_spinlock);
+    if (!claimed) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    
+    esp_err_t ret = prober_create(interval_ms, timeout_ms, max_missed, task_prio);
+    
+    taskENTER_CRITICAL(&s_prober_spinlock);
+    s_prober_state = (ret == ESP_OK) ? PROBER_RUNNING : PROBER_IDLE;
+    taskEXIT_CRITICAL(&s_prober_spinlock);
+    
+    return ret;
+}
+
+void ping_sta_prober_stop(void)
+{
+    // wait out a concurrent start/stop, then claim a running prober
+    uint8_t state;
+    for (;;) {
+        taskENTER_CRITICAL(&s_prober_spinlock);
+        state = s_prober_state;
+        if (state == PROBER_RUNNING) {
+            s_prober_state = PROBER_BUSY;
+        }
+        taskEXIT_CRITICAL(&s_prober_spinlock);
+        if (state != PROBER_BUSY) {
+            break;
+        }
+        vTaskDelay(1);
+    }
+    if (state == PROBER_IDLE) {
+        return;
+    }
+    
+    xEventGroupSetBits(s_prober_event_group, PROBER_STOP_BIT);
+    xEventGroupWaitBits(s_prober_event_group, PROBER_DONE_BIT, pdFALSE, pdFALSE, portMAX_DELAY);
+    
+    vEventGroupDelete(s_prober_event_group);
+    s_prober_event_group = NULL;
+    
+    // the stations belonged to an AP that may be gone
+    taskENTER_CRITICAL(&s_stats_spinlock);
+    s_stats_num = 0;
+    taskEXIT_CRITICAL(&s_stats_spinlock);
+    
+    taskENTER_CRITICAL(&s_prober_spinlock);
+    s_prober_state = PROBER_IDLE;
+    taskEXIT_CRITICAL(&s_prober_spinlock);
+}
+
+// copy per-station stats of the last round, returns number of stations
+int ping_sta_prober_get(ping_sta_stats_t *stats, int max)
+{
+    if (stats == NULL || max <= 0) {
+        return 0;
+    }
+    taskENTER_CRITICAL(&s_stats_spinlock);
+    int num = (s_stats_num < max) ? s_stats_num : max;
+    memcpy(stats, s_stats, num * sizeof(ping_sta_stats_t));
+    taskEXIT_CRITICAL(&s_stats_spinlock);
+    
+    return num;
+}
@@ -1,6 +1,8 @@
 #pragma once
 #include <stdint.h>
+#include <stdbool.h>
 #include <esp_err.h>
+#include <esp_netif.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -8,6 +10,24 @@ extern "C" {
 
 esp_err_t ping_initialize(uint32_t interval_ms, uint32_t task_prio, char * target_host);
 
+// --- Station prober ---
+typedef struct {
+    uint8_t mac[6];
+    esp_ip4_addr_t ip;      // DHCP-assigned address, 0 - not leased yet
+    uint32_t rtt_ms;        // last round trip time
+    uint32_t transmitted;
+    uint32_t received;
+    uint32_t loss;          // packet loss, %
+    uint8_t missed;         // consecutive rounds without reply
+} ping_sta_stats_t;
+
+// Requires a running SoftAP; wifi_ap_stop() stops the prober before destroying the AP netif
+esp_err_t ping_sta_prober_start(uint32_t interval_ms, uint32_t timeout_ms, uint8_t max_missed, uint32_t task_prio);
+void ping_sta_prober_stop(void);
+int ping_sta_prober_get(ping_sta_stats_t *stats, int max);
+// Round accounting of the prober, returns true when the station should be deauthenticated
+bool ping_sta_stats_update(ping_sta_stats_t *stats, bool sent, bool replied, uint32_t rtt_ms, uint8_t max_missed);
+
 #ifdef __cplusplus
 }
 #endif
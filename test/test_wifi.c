@@ -20,6 +20,28 @@ TEST_CASE("station", "[wifi]")
 }
 
 
+TEST_CASE("subscribe", "[wifi]")
+{
+    wifi_sub_handle_t sub;
+    wifi_link_event_t event;
+    TEST_ESP_OK(wifi_subscribe(WIFI_LINK_UP | WIFI_LINK_DOWN, 0, &sub));
+    
+    TEST_ESP_OK(wifi_sta_start(WIFI_STA_SSID, WIFI_STA_PASS, NULL, 0, 0));
+    TEST_ESP_OK(wifi_status_wait_for(WIFI_STATUS_CONNECTED, 1000));
+    TEST_ESP_OK(wifi_sub_receive(sub, &event, 1000));
+    TEST_ASSERT_EQUAL(WIFI_LINK_UP, event.event);
+    TEST_ASSERT_NOT_EQUAL(0, event.ip.addr);
+    
+    wifi_sta_stop();
+    TEST_ESP_OK(wifi_status_wait_for(WIFI_STATUS_OFF, 1000));
+    TEST_ESP_OK(wifi_sub_receive(sub, &event, 1000));
+    TEST_ASSERT_EQUAL(WIFI_LINK_DOWN, event.event);
+    TEST_ASSERT_EQUAL(WIFI_STATUS_OFF, event.status);
+    
+    wifi_unsubscribe(sub);
+}
+
+
 TEST_CASE("access point", "[wifi]")
 {    
     TEST_ASSERT_EQUAL(ESP_OK, wifi_ap_start(WIFI_AP_SSID, WIFI_AP_PASS, NULL));
@@ -27,6 +49,67 @@ TEST_CASE("access point", "[wifi]")
 }
 
 
+TEST_CASE("station prober", "[wifi]")
+{    
+    ping_sta_stats_t stats[CONFIG_WIFI_AP_MAX_STA_CONN];
+    
+    TEST_ASSERT_EQUAL(ESP_OK, wifi_ap_start(WIFI_AP_SSID, WIFI_AP_PASS, NULL));
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, ping_sta_prober_start(1000, 0, 3, 2));
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, ping_sta_prober_start(0, 500, 3, 2));
+    TEST_ESP_OK(ping_sta_prober_start(1000, 500, 3, 2));
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_STATE, ping_sta_prober_start(1000, 500, 3, 2));
+    
+    vTaskDelay(3000 / portTICK_PERIOD_MS);
+    
+    TEST_ASSERT_EQUAL(0, ping_sta_prober_get(NULL, 0));
+    TEST_ASSERT_EQUAL(0, ping_sta_prober_get(stats, 0));
+    TEST_ASSERT_EQUAL(0, ping_sta_prober_get(stats, -1));
+    // no stations attached
+    TEST_ASSERT_EQUAL(0, ping_sta_prober_get(stats, CONFIG_WIFI_AP_MAX_STA_CONN));
+    
+    wifi_ap_stop(); // stops the prober too
+    TEST_ASSERT_EQUAL(0, ping_sta_prober_get(stats, CONFIG_WIFI_AP_MAX_STA_CONN));
+}
+
+
+TEST_CASE("station prober stats", "[wifi]")
+{
+    ping_sta_stats_t stats = {0};
+    
+    // local send failure is not counted
+    TEST_ASSERT_FALSE(ping_sta_stats_update(&stats, false, false, 0, 2));
+    TEST_ASSERT_EQUAL(0, stats.transmitted);
+    TEST_ASSERT_EQUAL(0, stats.missed);
+    
+    TEST_ASSERT_FALSE(ping_sta_stats_update(&stats, true, true, 7, 2));
+    TEST_ASSERT_EQUAL(7, stats.rtt_ms);
+    TEST_ASSERT_EQUAL(0, stats.loss);
+    
+    TEST_ASSERT_FALSE(ping_sta_stats_update(&stats, true, false, 0, 2));
+    TEST_ASSERT_EQUAL(1, stats.missed);
+    TEST_ASSERT_EQUAL(50, stats.loss);
+    
+    // a reply resets the miss counter
+    TEST_ASSERT_FALSE(ping_sta_stats_update(&stats, true, true, 5, 2));
+    TEST_ASSERT_EQUAL(0, stats.missed);
+    
+    TEST_ASSERT_FALSE(ping_sta_stats_update(&stats, true, false, 0, 2));
+    TEST_ASSERT_FALSE(ping_sta_stats_update(&stats, false, false, 0, 2));
+    TEST_ASSERT_EQUAL(1, stats.missed);
+    TEST_ASSERT_TRUE(ping_sta_stats_update(&stats, true, false, 0, 2)); // deauth at max_missed
+    TEST_ASSERT_EQUAL(0, stats.missed);
+    TEST_ASSERT_EQUAL(5, stats.transmitted);
+    TEST_ASSERT_EQUAL(2, stats.received);
+    TEST_ASSERT_EQUAL(5, stats.rtt_ms);
+    
+    // max_missed 0 never deauthenticates
+    for (int i = 0; i < 10; i++) {
+        TEST_ASSERT_FALSE(ping_sta_stats_update(&stats, true, false, 0, 0));
+    }
+    TEST_ASSERT_EQUAL(10, stats.missed);
+}
+
+
 TEST_CASE("ping", "[wifi]")
 {
 
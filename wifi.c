@@ -1,10 +1,13 @@
 // https://github.com/espressif/esp-idf/blob/master/examples/wifi/getting_started/station/main/station_example_main.c
 #include <string.h>
 #include <sys/time.h>
+#include <inttypes.h>
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/event_groups.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
 #include "esp_system.h"
 #include "esp_wifi.h"
 #include "esp_event.h"
@@ -16,6 +19,7 @@
 #include "lwip/err.h"
 #include "lwip/sys.h"
 #include "wifi.h"
+#include "ping.h"
 
 // https://github.com/nopnop2002/esp-idf-ftpServer/blob/main/main/main.c
 #if (ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 0))
@@ -28,10 +32,15 @@
 
 #define WIFI_STA_MAXIMUM_RETRY      CONFIG_WIFI_STA_MAXIMUM_RETRY
 #define WIFI_STA_TIME_RETRY         CONFIG_WIFI_STA_TIME_RETRY
+#define WIFI_STA_RSSI_LOW           CONFIG_WIFI_STA_RSSI_LOW
+#define WIFI_STA_RSSI_REARM_TIME    CONFIG_WIFI_STA_RSSI_REARM_TIME
+#define WIFI_MAX_SUBSCRIBERS        CONFIG_WIFI_MAX_SUBSCRIBERS
+#define WIFI_SUB_QUEUE_LEN          CONFIG_WIFI_SUB_QUEUE_LEN
 
 static const char *TAG = "wifi";
 
 static TimerHandle_t s_reconnect_timer;
+static TimerHandle_t s_rssi_timer;
 
 /* FreeRTOS event group to signal when we are connected */
 static EventGroupHandle_t s_wifi_event_group;
@@ -51,6 +60,11 @@ static uint8_t s_wifi_status = WIFI_STATUS_OFF;
 
 static esp_event_handler_instance_t s_instance_any_id;
 static esp_event_handler_instance_t s_instance_got_ip;
+static esp_event_handler_instance_t s_instance_lost_ip;
+
+static esp_ip4_addr_t s_last_ip;
+static uint8_t s_last_bssid[6];
+static bool s_has_bssid;
 
 // dummy wi-fi status
 uint8_t wifi_status_get(void)
@@ -59,6 +73,182 @@ uint8_t wifi_status_get(void)
 }
 
 
+// --- Connectivity events ---
+
+struct wifi_sub {
+    uint32_t mask;
+    QueueHandle_t queue;
+    uint32_t dropped;
+};
+
+static struct wifi_sub s_subs[WIFI_MAX_SUBSCRIBERS];
+static portMUX_TYPE s_subs_spinlock = portMUX_INITIALIZER_UNLOCKED;
+
+/* Created on first use, so tasks can subscribe or wait before wifi_sta_start()
+ * and keep their handles across wifi_sta_stop() */
+static SemaphoreHandle_t s_subs_mutex;
+static EventGroupHandle_t s_status_event_group;
+
+static esp_err_t subs_init(void)
+{
+    if (s_subs_mutex) {
+        return ESP_OK;
+    }
+    // FreeRTOS API is not allowed inside a critical section, so create first and publish under the spinlock
+    SemaphoreHandle_t mutex = xSemaphoreCreateMutex();
+    EventGroupHandle_t group = xEventGroupCreate();
+    if (mutex == NULL || group == NULL) {
+        if (mutex) {
+            vSemaphoreDelete(mutex);
+        }
+        if (group) {
+            vEventGroupDelete(group);
+        }
+        return ESP_ERR_NO_MEM;
+    }
+    xEventGroupSetBits(group, BIT(s_wifi_status));
+    
+    bool published = false;
+    taskENTER_CRITICAL(&s_subs_spinlock);
+    if (s_subs_mutex == NULL) {
+        s_status_event_group = group;
+        s_subs_mutex = mutex;
+        published = true;
+    }
+    taskEXIT_CRITICAL(&s_subs_spinlock);
+    
+    if (!published) { // another task was first
+        vSemaphoreDelete(mutex);
+        vEventGroupDelete(group);
+    }
+    return ESP_OK;
+}
+
+// Events are posted without blocking, a slow subscriber only loses its own events
+static void link_event_publish(uint32_t event, int8_t rssi)
+{
+    wifi_link_event_t ev = {
+        .event = event,
+        .status = s_wifi_status,
+        .ip = s_last_ip,
+        .rssi = rssi,
+    };
+    memcpy(ev.bssid, s_last_bssid, sizeof(ev.bssid));
+    
+    ESP_ERROR_CHECK(subs_init()); // no caller to report to on the event handler path
+    xSemaphoreTake(s_subs_mutex, portMAX_DELAY);
+    for (int i = 0; i < WIFI_MAX_SUBSCRIBERS; i++) {
+        struct wifi_sub *sub = &s_subs[i];
+        if (sub->queue && (sub->mask & event)) {
+            if (xQueueSend(sub->queue, &ev, 0) != pdTRUE) {
+                sub->dropped++;
+                ESP_LOGW(TAG, "subscriber %d queue full, %"PRIu32" events dropped", i, sub->dropped);
+            }
+        }
+    }
+    xSemaphoreGive(s_subs_mutex);
+}
+
+static void status_set(uint8_t status)
+{
+    uint8_t prev = s_wifi_status;
+    s_wifi_status = status;
+    
+    ESP_ERROR_CHECK(subs_init());
+    xEventGroupClearBits(s_status_event_group, BIT(prev));
+    xEventGroupSetBits(s_status_event_group, BIT(status));
+    
+    if (prev == WIFI_STATUS_CONNECTED && status != WIFI_STATUS_CONNECTED) {
+        link_event_publish(WIFI_LINK_DOWN, 0);
+    }
+}
+
+esp_err_t wifi_status_wait_for(uint8_t status, uint32_t timeout_ms)
+{
+    if (status > WIFI_STATUS_FAIL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    esp_err_t ret = subs_init();
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    
+    TickType_t ticks = (timeout_ms == WIFI_WAIT_FOREVER) ? portMAX_DELAY : pdMS_TO_TICKS(timeout_ms);
+    EventBits_t bits = xEventGroupWaitBits(s_status_event_group, BIT(status), pdFALSE, pdTRUE, ticks);
+    
+    return (bits & BIT(status)) ? ESP_OK : ESP_ERR_TIMEOUT;
+}
+
+esp_err_t wifi_subscribe(uint32_t mask, uint8_t queue_len, wifi_sub_handle_t *sub)
+{
+    if (sub == NULL || (mask & WIFI_LINK_ALL) == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (queue_len == 0) {
+        queue_len = WIFI_SUB_QUEUE_LEN;
+    }
+    
+    QueueHandle_t queue = xQueueCreate(queue_len, sizeof(wifi_link_event_t));
+    if (queue == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    
+    esp_err_t ret = subs_init();
+    if (ret != ESP_OK) {
+        vQueueDelete(queue);
+        return ret;
+    }
+    ret = ESP_ERR_NO_MEM;
+    xSemaphoreTake(s_subs_mutex, portMAX_DELAY);
+    for (int i = 0; i < WIFI_MAX_SUBSCRIBERS; i++) {
+        if (s_subs[i].queue == NULL) {
+            s_subs[i].mask = mask;
+            s_subs[i].queue = queue;
+            s_subs[i].dropped = 0;
+            *sub = &s_subs[i];
+            ret = ESP_OK;
+            break;
+        }
+    }
+    xSemaphoreGive(s_subs_mutex);
+    
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "%s no free subscriber slots", __func__);
+        vQueueDelete(queue);
+    }
+    return ret;
+}
+
+esp_err_t wifi_sub_receive(wifi_sub_handle_t sub, wifi_link_event_t *event, uint32_t timeout_ms)
+{
+    if (sub == NULL || sub->queue == NULL || event == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    TickType_t ticks = (timeout_ms == WIFI_WAIT_FOREVER) ? portMAX_DELAY : pdMS_TO_TICKS(timeout_ms);
+    
+    return (xQueueReceive(sub->queue, event, ticks) == pdTRUE) ? ESP_OK : ESP_ERR_TIMEOUT;
+}
+
+void wifi_unsubscribe(wifi_sub_handle_t sub)
+{
+    if (sub == NULL) {
+        return;
+    }
+    if (subs_init() != ESP_OK) { // nothing was ever subscribed
+        return;
+    }
+    xSemaphoreTake(s_subs_mutex, portMAX_DELAY);
+    QueueHandle_t queue = sub->queue;
+    sub->queue = NULL;
+    sub->mask = 0;
+    xSemaphoreGive(s_subs_mutex);
+    
+    if (queue) {
+        vQueueDelete(queue);
+    }
+}
+
+
 static void reconnect_timer_callback(TimerHandle_t timer)
 {    
     if (s_wifi_status == WIFI_STATUS_FAIL) {  // reconnect
@@ -67,31 +257,78 @@ static void reconnect_timer_callback(TimerHandle_t timer)
     }
 }
 
+static void rssi_timer_callback(TimerHandle_t timer)
+{
+#if WIFI_STA_RSSI_LOW < 0
+    if (s_wifi_status == WIFI_STATUS_CONNECTED) {
+        esp_wifi_set_rssi_threshold(WIFI_STA_RSSI_LOW);
+    }
+#endif
+}
+
 static void event_handler(void* arg, esp_event_base_t event_base,
                                 int32_t event_id, void* event_data)
 {
     if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_START) {
-        s_wifi_status = WIFI_STATUS_OFF;
+        status_set(WIFI_STATUS_OFF);
         esp_wifi_connect();
+    } else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_CONNECTED) {
+        wifi_event_sta_connected_t* event = (wifi_event_sta_connected_t*) event_data;
+        bool roam = s_has_bssid && memcmp(s_last_bssid, event->bssid, sizeof(s_last_bssid)) != 0;
+        memcpy(s_last_bssid, event->bssid, sizeof(s_last_bssid));
+        s_has_bssid = true;
+        if (roam) {
+            ESP_LOGI(TAG, "roamed to "MACSTR, MAC2STR(event->bssid));
+            link_event_publish(WIFI_LINK_ROAM, 0);
+        }
+#if WIFI_STA_RSSI_LOW < 0
+        esp_wifi_set_rssi_threshold(WIFI_STA_RSSI_LOW);
+#endif
+    } else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_BSS_RSSI_LOW) {
+        wifi_event_bss_rssi_low_t* event = (wifi_event_bss_rssi_low_t*) event_data;
+        ESP_LOGW(TAG, "rssi low %"PRIi32" dBm", event->rssi);
+        link_event_publish(WIFI_LINK_DEGRADED, (int8_t)event->rssi);
+        // the threshold is one-shot, re-arm it later to report a lasting degradation again
+        xTimerStart(s_rssi_timer, 0);
     } else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_DISCONNECTED) {
-        s_wifi_status = WIFI_STATUS_OFF;
+        status_set(WIFI_STATUS_OFF);
         if (s_retry_num < s_max_retry) {
             esp_wifi_connect();
             s_retry_num++;
             ESP_LOGI(TAG, "retry %d to connect to the AP", s_retry_num);
         } else {
-            s_wifi_status = WIFI_STATUS_FAIL;
+            status_set(WIFI_STATUS_FAIL);
             s_retry_num = 0;
             xEventGroupSetBits(s_wifi_event_group, WIFI_FAIL_BIT);
             ESP_LOGI(TAG,"connect to the AP fail");
             xTimerStart(s_reconnect_timer, 0);
         }
     } else if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP) {
-        s_wifi_status = WIFI_STATUS_CONNECTED;
         ip_event_got_ip_t* event = (ip_event_got_ip_t*) event_data;
         ESP_LOGI(TAG, "got ip:" IPSTR, IP2STR(&event->ip_info.ip));
+        bool ip_changed = s_last_ip.addr != 0 && s_last_ip.addr != event->ip_info.ip.addr;
+        bool up = s_wifi_status != WIFI_STATUS_CONNECTED;
+        s_last_ip = event->ip_info.ip;
+        status_set(WIFI_STATUS_CONNECTED);
         s_retry_num = 0;
         xEventGroupSetBits(s_wifi_event_group, WIFI_CONNECTED_BIT);
+        if (up) {
+            link_event_publish(WIFI_LINK_UP, 0);
+        }
+        if (ip_changed) {
+            link_event_publish(WIFI_LINK_IP_CHANGE, 0);
+        }
+    } else if (event_base == IP_EVENT && event_id == IP_EVENT_STA_LOST_IP) {
+        ESP_LOGI(TAG, "lost ip");
+        bool had_ip = s_last_ip.addr != 0;
+        s_last_ip.addr = 0;
+        // no address, no link even if still associated
+        if (s_wifi_status == WIFI_STATUS_CONNECTED) {
+            status_set(WIFI_STATUS_OFF);
+        }
+        if (had_ip) {
+            link_event_publish(WIFI_LINK_IP_CHANGE, 0);
+        }
     }
 }
 
@@ -128,6 +365,15 @@ esp_err_t wifi_sta_start(const char* wifi_sta_ssid, const char* wifi_sta_pass, c
         esp_netif_set_ip_info(s_sta_netif, ip_info);
     }
     
+    if (s_rssi_timer == NULL) {
+        s_rssi_timer = xTimerCreate("rssi_timer", WIFI_STA_RSSI_REARM_TIME * 1000 / portTICK_PERIOD_MS,
+                                    pdFALSE, (void *)0, rssi_timer_callback);
+        if (s_rssi_timer == NULL) {
+            ESP_LOGI(TAG, "%s The timer was not created", __func__);
+            return ESP_FAIL;
+        }
+    }
+    
     wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
     ESP_ERROR_CHECK(esp_wifi_init(&cfg));
     
@@ -141,6 +387,11 @@ esp_err_t wifi_sta_start(const char* wifi_sta_ssid, const char* wifi_sta_pass, c
                                                         &event_handler,
                                                         NULL,
                                                         &s_instance_got_ip));    
+    ESP_ERROR_CHECK(esp_event_handler_instance_register(IP_EVENT,
+                                                        IP_EVENT_STA_LOST_IP,
+                                                        &event_handler,
+                                                        NULL,
+                                                        &s_instance_lost_ip));
     
     wifi_config_t wifi_config = {};
     
@@ -212,16 +463,22 @@ esp_err_t wifi_sta_start(const char* wifi_sta_ssid, const char* wifi_sta_pass, c
 void wifi_sta_stop(void)
 {
     xTimerStop(s_reconnect_timer, 0);
+    if (s_rssi_timer) {
+        xTimerStop(s_rssi_timer, 0);
+    }
     
     if (sntp_enabled()) {
         sntp_stop();    
     }
     
     /* The event will not be processed after unregister */
+    ESP_ERROR_CHECK(esp_event_handler_instance_unregister(IP_EVENT, IP_EVENT_STA_LOST_IP, s_instance_lost_ip));
     ESP_ERROR_CHECK(esp_event_handler_instance_unregister(IP_EVENT, IP_EVENT_STA_GOT_IP, s_instance_got_ip));
     ESP_ERROR_CHECK(esp_event_handler_instance_unregister(WIFI_EVENT, ESP_EVENT_ANY_ID, s_instance_any_id));
 
-    s_wifi_status = WIFI_STATUS_OFF;
+    status_set(WIFI_STATUS_OFF);
+    s_last_ip.addr = 0;
+    s_has_bssid = false;
     esp_err_t err = esp_wifi_stop();
     if (err == ESP_ERR_WIFI_NOT_INIT) {
         return;
@@ -371,6 +628,8 @@ esp_err_t wifi_ap_start(const char* wifi_ap_ssid, const char* wifi_ap_pass, cons
 
 void wifi_ap_stop(void)
 {
+    ping_sta_prober_stop(); // the prober uses the AP netif destroyed below
+    
     esp_err_t err = esp_wifi_stop();
     if (err == ESP_ERR_WIFI_NOT_INIT) {
         return;
@@ -42,6 +42,39 @@ void wifi_ap_stop(void);
 
 uint8_t wifi_status_get(void);
 
+#define WIFI_WAIT_FOREVER     (UINT32_MAX)
+
+// Block until the station reaches the given WIFI_STATUS_xxx, ESP_ERR_TIMEOUT otherwise
+esp_err_t wifi_status_wait_for(uint8_t status, uint32_t timeout_ms);
+
+
+// --- Connectivity events ---
+#define WIFI_LINK_UP          (1 << 0)  // got IP address
+#define WIFI_LINK_DOWN        (1 << 1)  // lost connection to the AP
+#define WIFI_LINK_IP_CHANGE   (1 << 2)  // got a different IP address or lost it (ip is 0)
+#define WIFI_LINK_ROAM        (1 << 3)  // associated with another BSSID
+#define WIFI_LINK_DEGRADED    (1 << 4)  // RSSI below CONFIG_WIFI_STA_RSSI_LOW, repeated every CONFIG_WIFI_STA_RSSI_REARM_TIME
+#define WIFI_LINK_ALL         (0x1F)
+
+typedef struct {
+    uint32_t event;         // one of WIFI_LINK_xxx
+    uint8_t status;         // WIFI_STATUS_xxx after the event
+    esp_ip4_addr_t ip;
+    uint8_t bssid[6];
+    int8_t rssi;
+} wifi_link_event_t;
+
+typedef struct wifi_sub *wifi_sub_handle_t;
+
+/*
+    mask - WIFI_LINK_xxx events to deliver
+    queue_len - number of events buffered for the subscriber, 0 - default
+*/
+esp_err_t wifi_subscribe(uint32_t mask, uint8_t queue_len, wifi_sub_handle_t *sub);
+esp_err_t wifi_sub_receive(wifi_sub_handle_t sub, wifi_link_event_t *event, uint32_t timeout_ms);
+// Only the task that receives from the subscription may unsubscribe, never while blocked in wifi_sub_receive()
+void wifi_unsubscribe(wifi_sub_handle_t sub);
+
 
 
 #ifdef __cplusplus